@@ -0,0 +1,143 @@
+/* TODO write some fancy header with copyright information */
+/**/
+/**/
+/**/
+/**/
+/**/
+/**/
+/**/
+
+#include "sdmmc_diskio.h"
+
+#include "ff.h"
+#include "diskio.h"
+
+#include <stddef.h>
+
+/* The data path is polled SPI, which has no alignment requirement, *
+ * so FatFs buffers are passed through without any bounce buffer.   */
+
+/* FatFs R0.14+ may be configured for 64 bit LBA, older ones use DWORD */
+#if defined(FF_LBA64) && FF_LBA64
+typedef LBA_t sector_t;
+#else
+typedef DWORD sector_t;
+#endif
+
+static SDMMC_SPI_HandleTypeDef *drives[SDMMC_DISKIO_DRIVES];
+
+/***************************************
+ * Helper functions
+ **************************************/
+
+static SDMMC_SPI_HandleTypeDef* getDrive(BYTE pdrv) {
+	if (pdrv >= SDMMC_DISKIO_DRIVES)
+		return NULL;
+	return drives[pdrv];
+}
+
+/* The driver rejects these as well, but only as a generic SMST_ERROR */
+static int isOutOfRange(SDMMC_SPI_HandleTypeDef *hsdmmc, sector_t sector,
+		UINT count) {
+	if (SDMMC_get_state(hsdmmc) != SMST_READY)
+		return 0; /* Reported as not ready by the driver */
+	return count > hsdmmc->blockcount || sector > hsdmmc->blockcount - count;
+}
+
+static DRESULT toDRESULT(SDMMC_State state) {
+	switch (state) {
+	case SMST_READY:
+		return RES_OK;
+	case SMST_ERROR:
+		return RES_ERROR;
+	default:
+		return RES_NOTRDY;
+	}
+}
+
+/***************************************
+ * Public methods
+ **************************************/
+
+void SDMMC_diskio_link(uint8_t pdrv, SDMMC_SPI_HandleTypeDef *hsdmmc) {
+	if (pdrv < SDMMC_DISKIO_DRIVES)
+		drives[pdrv] = hsdmmc;
+}
+
+/***************************************
+ * FatFs Media Access Interface
+ **************************************/
+
+DSTATUS disk_initialize(BYTE pdrv) {
+	SDMMC_SPI_HandleTypeDef *hsdmmc = getDrive(pdrv);
+
+	if (hsdmmc == NULL)
+		return STA_NOINIT | STA_NODISK;
+
+	/* Allow a retry after a previously failed initialization */
+	if (hsdmmc->state == SMST_ERROR)
+		hsdmmc->state = SMST_RESET;
+	SDMMC_initialize(hsdmmc);
+
+	return disk_status(pdrv);
+}
+
+DSTATUS disk_status(BYTE pdrv) {
+	SDMMC_SPI_HandleTypeDef *hsdmmc = getDrive(pdrv);
+
+	if (hsdmmc == NULL)
+		return STA_NOINIT | STA_NODISK;
+
+	switch (SDMMC_get_state(hsdmmc)) {
+	case SMST_RESET:
+	case SMST_ERROR:
+	case SMST_STREAM: /* The card is owned by an open write stream */
+		return STA_NOINIT;
+	default:
+		return 0;
+	}
+}
+
+DRESULT disk_read(BYTE pdrv, BYTE *buff, sector_t sector, UINT count) {
+	SDMMC_SPI_HandleTypeDef *hsdmmc = getDrive(pdrv);
+
+	if (hsdmmc == NULL || count == 0 || isOutOfRange(hsdmmc, sector, count))
+		return RES_PARERR;
+
+	return toDRESULT(SDMMC_read64(hsdmmc, buff, sector, count));
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE *buff, sector_t sector,
+		UINT count) {
+	SDMMC_SPI_HandleTypeDef *hsdmmc = getDrive(pdrv);
+
+	if (hsdmmc == NULL || count == 0 || isOutOfRange(hsdmmc, sector, count))
+		return RES_PARERR;
+
+	return toDRESULT(SDMMC_write64(hsdmmc, buff, sector, count));
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff) {
+	SDMMC_SPI_HandleTypeDef *hsdmmc = getDrive(pdrv);
+
+	if (hsdmmc == NULL)
+		return RES_PARERR;
+
+#if defined(FF_LBA64) && FF_LBA64
+	/* The driver ioctl works with DWORD sectors, these need the full LBA */
+	switch (cmd) {
+	case GET_SECTOR_COUNT:
+		if (SDMMC_get_state(hsdmmc) != SMST_READY)
+			return RES_NOTRDY;
+		*(LBA_t*) buff = hsdmmc->blockcount;
+		return RES_OK;
+	case CTRL_TRIM:
+		return (DRESULT) SDMMC_trim(hsdmmc, ((LBA_t*) buff)[0],
+				((LBA_t*) buff)[1]);
+	default:
+		break;
+	}
+#endif
+
+	return (DRESULT) SDMMC_ioctl(hsdmmc, cmd, buff);
+}
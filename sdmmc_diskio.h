@@ -0,0 +1,24 @@
+/* TODO write some fancy header with copyright information */
+/**/
+/**/
+/**/
+/**/
+/**/
+/* FatFs Media Access Interface glue for the SDMMC SPI driver */
+
+#ifndef SDMMC_DISKIO_H_
+#define SDMMC_DISKIO_H_
+
+#include "sdmmc_spi.h"
+
+/* Number of FatFs physical drives served by this driver */
+#ifndef SDMMC_DISKIO_DRIVES
+#define SDMMC_DISKIO_DRIVES 1U
+#endif
+
+/* Assigns an SDMMC handle to the FatFs physical drive number pdrv.    *
+ * While a write stream is open on the handle the drive reports        *
+ * STA_NOINIT, so FatFs must not access it until the stream is closed. */
+void SDMMC_diskio_link(uint8_t pdrv, SDMMC_SPI_HandleTypeDef *hsdmmc);
+
+#endif /* SDMMC_DISKIO_H_ */
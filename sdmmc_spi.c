@@ -23,13 +23,49 @@
 #define CMD16    (0x40+16)    	/* SET_BLOCKLEN */
 #define CMD17    (0x40+17)    	/* READ_SINGLE_BLOCK */
 #define CMD18    (0x40+18)    	/* READ_MULTIPLE_BLOCK */
+#define CMD22    (0x40+22)    	/* ADDRESS_EXTENSION (SDUC) */
 #define ACMD23   (0x40+23)    	/* SET_BLOCK_COUNT */
 #define CMD24    (0x40+24)    	/* WRITE_BLOCK */
 #define CMD25    (0x40+25)    	/* WRITE_MULTIPLE_BLOCK */
+#define CMD32    (0x40+32)    	/* ERASE_WR_BLK_START */
+#define CMD33    (0x40+33)    	/* ERASE_WR_BLK_END */
+#define CMD38    (0x40+38)    	/* ERASE */
 #define ACMD41   (0x40+41)    	/* SEND_OP_COND (ACMD) */
 #define CMD55    (0x40+55)    	/* APP_CMD */
 #define CMD58    (0x40+58)    	/* READ_OCR */
 
+/* Data tokens */
+#define TOKEN_SINGLE_BLOCK  0xFE	/* Start Block (CMD17/18/24) */
+#define TOKEN_MULTI_WRITE   0xFC	/* Start Block (CMD25) */
+#define TOKEN_STOP_TRAN     0xFD	/* Stop Tran (CMD25) */
+#define DATA_RES_MASK       0x1F
+#define DATA_RES_ACCEPTED   0x05	/* Data accepted */
+
+/* Transfer block and logical sector size. Byte addressed cards are set to *
+ * it with CMD16, whatever READ_BL_LEN / WRITE_BL_LEN of the CSD say.      */
+#define BLOCKLEN            512U
+
+/* Card class and feature specialization (see sdmmc_spi_conf.h) */
+#if SDMMC_CONF_SDHC_ONLY
+#define CARD_BLOCK_ADDRESSED(h)	1
+#define CARD_IS_MMC(h)			0
+#else
+#define CARD_BLOCK_ADDRESSED(h)	((h)->type >= CT_SDHC)
+#define CARD_IS_MMC(h)			((h)->type == CT_MMC)
+#endif
+
+#if SDMMC_CONF_SDUC
+#define CARD_IS_SDUC(h)			((h)->type == CT_SDUC)
+#else
+#define CARD_IS_SDUC(h)			0
+#endif
+
+#if SDMMC_CONF_DIAG
+#define DIAG_SET(h, field, value)	((h)->field = (value))
+#else
+#define DIAG_SET(h, field, value)	((void) 0)
+#endif
+
 typedef uint8_t command_t;
 typedef uint32_t argument_t;
 
@@ -67,6 +103,8 @@ static const regSlice VDD_WR_CURR_MAX = {50,3}; /* MAX Write Current at Vdd MAX
 static const regSlice C_SIZE_MULT = {47,3}; /* Device Capacity Multiplier */
 static const regSlice ERASE_BLK_EN = {46,1}; /* Erase Single Block Allowed */
 static const regSlice ERASE_SECTOR_SIZE = {39,7}; /* Erase Sector Size */
+static const regSlice ERASE_GRP_SIZE = {42,5}; /* Erase Group Size (MMC) */
+static const regSlice ERASE_GRP_MULT = {37,5}; /* Erase Group Size Multiplier (MMC) */
 static const regSlice WP_GRP_SIZE = {32,7}; /* Write Protect Group Size */
 static const regSlice WP_GRP_ENABLE = {31,1}; /* Write Protect Group Enabled */
 static const regSlice R2W_FACTOR = {26,3}; /* Write Speed Factor */
@@ -102,7 +140,7 @@ uint8_t getCRC7(const uint8_t *data, uint32_t length) {
 
 uint16_t getCRC16(const uint8_t *data, uint32_t length) {
 	uint8_t x;
-	uint16_t crc = 0xFFFF;
+	uint16_t crc = 0; /* SD data CRC16 (CCITT, zero initial value) */
 
 	while (length--) {
 		x = crc >> 8 ^ *data++;
@@ -163,6 +201,44 @@ SDMMC_Result SDMMC_ReadyWait(SDMMC_SPI_HandleTypeDef *hsdmmc) {
 	return SDMMC_RES_OK;
 }
 
+/* Pooling the card until it releases MISO (busy signal ends) */
+SDMMC_Status SDMMC_busy_wait_timeout(SDMMC_SPI_HandleTypeDef *hsdmmc,
+		uint32_t timeout) {
+	uint32_t tickstart = HAL_GetTick();
+	SDMMC_Status sta;
+	uint8_t token;
+
+	do {
+		while (!__HAL_SPI_GET_FLAG(hsdmmc->hspi, SPI_FLAG_TXE))
+			;
+		sta = HAL_SPI_TransmitReceive(hsdmmc->hspi, (uint8_t*) dummy, &token, 1,
+				hsdmmc->timeout);
+		if (sta != SM_OK)
+			return sta;   //HAL error
+		if ((HAL_GetTick() - tickstart) > timeout)
+			return SM_TIMEOUT;
+	} while (token != 0xff);
+
+	return SM_OK;
+}
+
+SDMMC_Status SDMMC_busy_wait(SDMMC_SPI_HandleTypeDef *hsdmmc) {
+	return SDMMC_busy_wait_timeout(hsdmmc, hsdmmc->timeout);
+}
+
+/* Block addressed cards take the sector number, the others a byte offset */
+argument_t SDMMC_block_address(SDMMC_SPI_HandleTypeDef *hsdmmc,
+		uint32_t sector) {
+#if SDMMC_CONF_SDHC_ONLY
+	(void) hsdmmc;
+	return sector;
+#else
+	if (CARD_BLOCK_ADDRESSED(hsdmmc))
+		return sector;
+	return sector * BLOCKLEN;
+#endif
+}
+
 /* Also handles R1b */
 SDMMC_Status SDMMC_receive_R1(SDMMC_SPI_HandleTypeDef *hsdmmc) {
 	uint8_t ncr = 8;
@@ -259,17 +335,27 @@ SDMMC_Status SDMMC_command(SDMMC_SPI_HandleTypeDef *hsdmmc, const command_t ind,
 			sizeof(SDMMC_CommandFrame), hsdmmc->timeout);
 	if (sta == SM_OK) {
 		switch (ind) {
+		case CMD12:
+			/* Skip the stuff byte following CMD12 */
+			while (!__HAL_SPI_GET_FLAG(hsdmmc->hspi, SPI_FLAG_TXE))
+				;
+			sta = HAL_SPI_TransmitReceive(hsdmmc->hspi, (uint8_t*) dummy,
+					&hsdmmc->response.R1.BYTE, 1, hsdmmc->timeout);
+			if (sta == SM_OK)
+				sta = SDMMC_receive_R1(hsdmmc);
+			DIAG_SET(hsdmmc, response_type, RT_R1);
+			break;
 		case CMD8:
 			sta = SDMMC_receive_R3_R7(hsdmmc);
-			hsdmmc->response_type = RT_R7;
+			DIAG_SET(hsdmmc, response_type, RT_R7);
 			break;
 		case CMD58:
 			sta = SDMMC_receive_R3_R7(hsdmmc);
-			hsdmmc->response_type = RT_R3;
+			DIAG_SET(hsdmmc, response_type, RT_R3);
 			break;
 		default:
 			sta = SDMMC_receive_R1(hsdmmc);
-			hsdmmc->response_type = RT_R1;
+			DIAG_SET(hsdmmc, response_type, RT_R1);
 		}
 		if (sta == SM_OK) {
 			if (hsdmmc->response.R1.BYTE & ~R1_IDLE)
@@ -281,27 +367,53 @@ SDMMC_Status SDMMC_command(SDMMC_SPI_HandleTypeDef *hsdmmc, const command_t ind,
 	return sta;
 }
 
+/* Issues an addressed command (read, write, erase). SDUC cards receive *
+ * the address bits [37:32] in a preceding CMD22, the caller must keep  *
+ * the card selected so the two commands stay together.                 */
+SDMMC_Status SDMMC_command_sector(SDMMC_SPI_HandleTypeDef *hsdmmc,
+		const command_t ind, uint64_t sector) {
+	SDMMC_Status sta;
+
+	if (CARD_IS_SDUC(hsdmmc)) {
+		sta = SDMMC_command(hsdmmc, CMD22, (argument_t) (sector >> 32) & 0x3f);
+		if (sta != SM_OK)
+			return sta;
+		return SDMMC_command(hsdmmc, ind, (argument_t) sector);
+	}
+
+	if (sector > UINT32_MAX)
+		return SM_ERROR;
+	return SDMMC_command(hsdmmc, ind,
+			SDMMC_block_address(hsdmmc, (uint32_t) sector));
+}
+
 SDMMC_Status SDMMC_read_datablock(SDMMC_SPI_HandleTypeDef *hsdmmc, uint8_t *buf,
 		uint16_t size) {
-	uint16_t retryCount = 0;
-	uint16_t CRC16;
+	uint32_t tickstart = HAL_GetTick();
+	uint8_t CRC16[2];
 	SDMMC_Status sta;
 	uint8_t token;
+#if SDMMC_CONF_DATA_CRC
+	const uint8_t *data = buf;
+	const uint16_t length = size;
+#endif
 
 	/* Pooling for a valid Data Token */
 	do {
 		while (!__HAL_SPI_GET_FLAG(hsdmmc->hspi, SPI_FLAG_TXE))
 			;
-		retryCount++;
 		sta = HAL_SPI_TransmitReceive(hsdmmc->hspi, (uint8_t*) dummy, &token, 1,
 				hsdmmc->timeout);
+		if (sta == SM_OK && token == 0xff
+				&& (HAL_GetTick() - tickstart) > hsdmmc->timeout)
+			return SM_TIMEOUT;   //Card removed or stalled
 	} while (sta == SM_OK && token == 0xff);
 	if (sta != SM_OK) {
-		hsdmmc->errorToken = token;
+		DIAG_SET(hsdmmc, errorToken, token);
 		return sta;
 	}
-	if (token != 0xfe) {
-		hsdmmc->errorToken = token;
+	if (token != TOKEN_SINGLE_BLOCK) {
+		DIAG_SET(hsdmmc, errorToken, token);
 		return SM_ERROR;
 	}
 
@@ -325,18 +437,136 @@ SDMMC_Status SDMMC_read_datablock(SDMMC_SPI_HandleTypeDef *hsdmmc, uint8_t *buf,
 		buf += 16;
 	}
 
-	/* Receive CRC but discarding it for now */
+	/* Receive CRC (big endian), it is only checked with SDMMC_CONF_DATA_CRC */
 	while (!__HAL_SPI_GET_FLAG(hsdmmc->hspi, SPI_FLAG_TXE))
 		;
-	sta = HAL_SPI_TransmitReceive(hsdmmc->hspi, (uint8_t*) dummy,
-			(uint8_t*) &CRC16, 2, hsdmmc->timeout);
+	sta = HAL_SPI_TransmitReceive(hsdmmc->hspi, (uint8_t*) dummy, CRC16, 2,
+			hsdmmc->timeout);
+#if SDMMC_CONF_DATA_CRC
+	if (sta == SM_OK
+			&& getCRC16(data, length) != (uint16_t) ((CRC16[0] << 8) | CRC16[1]))
+		sta = SM_ERROR;
+#endif
 
 	return sta;
 }
 
-//SDMMC_Status SDMMC_write_datablock(SDMMC_SPI_HandleTypeDef *hsdmmc, const uint8_t *buf, uint32_t size) {
-//
-//}
+/* The busy state of the previous block is awaited before sending the token *
+ * instead of after the data response, so the caller is free to prepare the *
+ * next block while the card is programming the current one.                */
+SDMMC_Status SDMMC_write_datablock(SDMMC_SPI_HandleTypeDef *hsdmmc,
+		const uint8_t *buf, uint16_t size, uint8_t token) {
+	SDMMC_Status sta;
+	uint8_t response;
+#if SDMMC_CONF_DATA_CRC
+	const uint16_t crc = getCRC16(buf, size);
+	const uint8_t CRC16[2] = { crc >> 8, crc & 0xff };
+#else
+	const uint8_t *CRC16 = dummy;
+#endif
+
+	sta = SDMMC_busy_wait(hsdmmc);
+	if (sta != SM_OK)
+		return sta;
+
+	while (!__HAL_SPI_GET_FLAG(hsdmmc->hspi, SPI_FLAG_TXE))
+		;
+	sta = HAL_SPI_Transmit(hsdmmc->hspi, &token, 1, hsdmmc->timeout);
+	if (sta != SM_OK)
+		return sta;
+
+	while (!__HAL_SPI_GET_FLAG(hsdmmc->hspi, SPI_FLAG_TXE))
+		;
+	sta = HAL_SPI_Transmit(hsdmmc->hspi, (uint8_t*) buf, size,
+			hsdmmc->timeout);
+	if (sta != SM_OK)
+		return sta;
+
+	/* Not checked by the card unless CRC mode is on */
+	while (!__HAL_SPI_GET_FLAG(hsdmmc->hspi, SPI_FLAG_TXE))
+		;
+	sta = HAL_SPI_Transmit(hsdmmc->hspi, (uint8_t*) CRC16, 2, hsdmmc->timeout);
+	if (sta != SM_OK)
+		return sta;
+
+	while (!__HAL_SPI_GET_FLAG(hsdmmc->hspi, SPI_FLAG_TXE))
+		;
+	sta = HAL_SPI_TransmitReceive(hsdmmc->hspi, (uint8_t*) dummy, &response,
+			1, hsdmmc->timeout);
+	if (sta != SM_OK)
+		return sta;
+	DIAG_SET(hsdmmc, responseToken, response);
+	if ((response & DATA_RES_MASK) != DATA_RES_ACCEPTED)
+		return SM_ERROR;
+
+	return SM_OK;
+}
+
+/* Starts a CMD25 transfer at sector, pre-erasing count blocks (ACMD23) on *
+ * SD cards. The card is left selected on success.                         */
+SDMMC_Status SDMMC_multi_write_begin(SDMMC_SPI_HandleTypeDef *hsdmmc,
+		uint64_t sector, uint32_t count) {
+	SDMMC_Status sta;
+
+	if (count && !CARD_IS_MMC(hsdmmc)) {
+		/* SET_WR_BLK_ERASE_COUNT is 23 bits wide, saturate larger counts */
+		sta = SDMMC_command(hsdmmc, ACMD23,
+				count > 0x007fffff ? 0x007fffff : count);
+		if (sta != SM_OK)
+			return sta;
+	}
+
+	/* CS stays asserted for the whole transfer */
+	SDMMC_select(hsdmmc);
+	sta = SDMMC_command_sector(hsdmmc, CMD25, sector);
+	if (sta != SM_OK)
+		SDMMC_deselect(hsdmmc);
+
+	return sta;
+}
+
+/* Terminates the CMD25 transfer with the Stop Tran token, waits until the *
+ * card finished programming and releases it.                              */
+SDMMC_Status SDMMC_multi_write_end(SDMMC_SPI_HandleTypeDef *hsdmmc) {
+	const uint8_t stop[2] = { TOKEN_STOP_TRAN, 0xff }; /* token + Nbr byte */
+	SDMMC_Status sta;
+
+	sta = SDMMC_busy_wait(hsdmmc);
+	if (sta == SM_OK) {
+		while (!__HAL_SPI_GET_FLAG(hsdmmc->hspi, SPI_FLAG_TXE))
+			;
+		sta = HAL_SPI_Transmit(hsdmmc->hspi, (uint8_t*) stop, 2,
+				hsdmmc->timeout);
+	}
+	if (sta == SM_OK)
+		sta = SDMMC_busy_wait(hsdmmc);
+
+	SDMMC_deselect(hsdmmc);
+	return sta;
+}
+
+/* Erases the blocks from start to end (inclusive), R1b of CMD38 is awaited. *
+ * A card still busy after the erase timeout can't take commands, so the    *
+ * handle is put into SMST_ERROR until it is re-initialized.                */
+SDMMC_Status SDMMC_erase(SDMMC_SPI_HandleTypeDef *hsdmmc, uint64_t start,
+		uint64_t end) {
+	SDMMC_Status sta;
+
+	SDMMC_select(hsdmmc);
+	sta = SDMMC_command_sector(hsdmmc, CMD32, start);
+	if (sta == SM_OK)
+		sta = SDMMC_command_sector(hsdmmc, CMD33, end);
+	if (sta == SM_OK)
+		sta = SDMMC_command(hsdmmc, CMD38, 0);
+	if (sta == SM_OK) {
+		sta = SDMMC_busy_wait_timeout(hsdmmc, SDMMC_CONF_ERASE_TIMEOUT);
+		if (sta != SM_OK)
+			hsdmmc->state = SMST_ERROR;
+	}
+	SDMMC_deselect(hsdmmc);
+
+	return sta;
+}
 
 /***************************************
  * Public SDMMC methods
@@ -376,7 +606,9 @@ SDMMC_State SDMMC_initialize(SDMMC_SPI_HandleTypeDef *hsdmmc) {
 	if (sta == SM_OK) {
 		retry = hsdmmc->max_retry;
 		do {
-			sta = SDMMC_command(hsdmmc, ACMD41, 0x40000000);
+			/* HCS and HO2T: host supports SDHC/SDXC and SDUC */
+			sta = SDMMC_command(hsdmmc, ACMD41,
+					SDMMC_CONF_SDUC ? 0x48000000 : 0x40000000);
 			if (sta != SM_OK || --retry == 0) {
 				hsdmmc->state = SMST_ERROR;
 				return hsdmmc->state;   //Init error
@@ -388,14 +620,25 @@ SDMMC_State SDMMC_initialize(SDMMC_SPI_HandleTypeDef *hsdmmc) {
 			hsdmmc->state = SMST_ERROR;
 			return hsdmmc->state; //Init error
 		}
+#if SDMMC_CONF_KEEP_REGS
 		hsdmmc->OCR = hsdmmc->response.OCR;
-		if (hsdmmc->OCR.CCS) {
-			hsdmmc->type = CT_SDHC;
-			/* TODO detect CT_SDUC as well */
+#endif
+		if (hsdmmc->response.OCR.CCS) {
+			hsdmmc->type = SDMMC_CONF_SDUC && hsdmmc->response.OCR.CO2T ?
+					CT_SDUC : CT_SDHC;
 		} else {
+#if SDMMC_CONF_SDHC_ONLY
+			hsdmmc->state = SMST_ERROR;
+			return hsdmmc->state; //Byte addressed card not supported
+#else
 			hsdmmc->type = CT_SD2;
+#endif
 		}
 	} else {
+#if SDMMC_CONF_SDHC_ONLY
+		hsdmmc->state = SMST_ERROR;
+		return hsdmmc->state; //SD1 and MMC are not supported
+#else
 		/* SD1 init */
 		retry = hsdmmc->max_retry;
 		do {
@@ -421,6 +664,16 @@ SDMMC_State SDMMC_initialize(SDMMC_SPI_HandleTypeDef *hsdmmc) {
 				return hsdmmc->state;
 			}
 		}
+#endif
+	}
+
+	/* Byte addressed cards may default to a larger block length (2GB / 4GB) */
+	if (!CARD_BLOCK_ADDRESSED(hsdmmc)) {
+		sta = SDMMC_command(hsdmmc, CMD16, BLOCKLEN);
+		if (sta != SM_OK) {
+			hsdmmc->state = SMST_ERROR;
+			return hsdmmc->state; //Init error
+		}
 	}
 
 	/* TODO set SPI clock back high according to IF_COND or OP_COND registers */
@@ -434,16 +687,17 @@ SDMMC_State SDMMC_initialize(SDMMC_SPI_HandleTypeDef *hsdmmc) {
 	sta = SDMMC_command(hsdmmc, CMD9, 0);
 	if (sta != SM_OK) {
 		hsdmmc->state = SMST_ERROR;
-		return hsdmmc->state;
+		goto end;
 	} else {
 		sta = SDMMC_read_datablock(hsdmmc, hsdmmc->CSD, 16);
 		if (sta != SM_OK) {
 			hsdmmc->state = SMST_ERROR;
-			return hsdmmc->state;
+			goto end;
 		}
 		bswap128(hsdmmc->CSD);
 	}
 
+#if SDMMC_CONF_KEEP_REGS
 	/* Read CID Register */
 	sta = SDMMC_command(hsdmmc, CMD10, 0);
 	if (sta != SM_OK) {
@@ -457,21 +711,26 @@ SDMMC_State SDMMC_initialize(SDMMC_SPI_HandleTypeDef *hsdmmc) {
 		}
 		bswap128(hsdmmc->CID);
 	}
-
-	hsdmmc->CSD_ver = hsdmmc->type == CT_MMC ? 1 : (uint8_t)unpackReg(hsdmmc->CSD, CSD_VER) + 1;
-	hsdmmc->blocklen_RD = (1 << (uint8_t)unpackReg(hsdmmc->CSD, READ_BL_LEN));
-	hsdmmc->blocklen_WR = (1 << (uint8_t)unpackReg(hsdmmc->CSD, WRITE_BL_LEN));
-	hsdmmc->sectorlen = (uint8_t)unpackReg(hsdmmc->CSD, ERASE_SECTOR_SIZE) + 1;
-	if (hsdmmc->CSD_ver == 1) {
-		/* (page 229) */
-		hsdmmc->blockcount = ((uint16_t)unpackReg(hsdmmc->CSD, C_SIZE_v1) + 1)
-				* (1 << ((uint8_t)unpackReg(hsdmmc->CSD, C_SIZE_MULT) + 2));
-		hsdmmc->capacity = hsdmmc->blockcount * hsdmmc->blocklen_RD;
+#endif
+
+	hsdmmc->CSD_ver = CARD_IS_MMC(hsdmmc) ? 1 : (uint8_t)unpackReg(hsdmmc->CSD, CSD_VER) + 1;
+	/* Erase unit is given in write blocks, rescaled to BLOCKLEN sectors */
+	if (CARD_IS_MMC(hsdmmc))
+		hsdmmc->sectorlen = ((uint16_t)unpackReg(hsdmmc->CSD, ERASE_GRP_SIZE) + 1)
+				* ((uint16_t)unpackReg(hsdmmc->CSD, ERASE_GRP_MULT) + 1);
+	else
+		hsdmmc->sectorlen = (uint16_t)unpackReg(hsdmmc->CSD, ERASE_SECTOR_SIZE) + 1;
+	if (unpackReg(hsdmmc->CSD, WRITE_BL_LEN) > 9)
+		hsdmmc->sectorlen <<= unpackReg(hsdmmc->CSD, WRITE_BL_LEN) - 9;
+	if (!SDMMC_CONF_SDHC_ONLY && hsdmmc->CSD_ver == 1) {
+		/* (page 229) capacity in READ_BL_LEN blocks, rescaled to BLOCKLEN */
+		hsdmmc->blockcount = ((SDMMC_SectorCount)unpackReg(hsdmmc->CSD, C_SIZE_v1) + 1)
+				<< ((uint8_t)unpackReg(hsdmmc->CSD, C_SIZE_MULT) + 2
+						+ (uint8_t)unpackReg(hsdmmc->CSD, READ_BL_LEN) - 9);
 	} else {
-		/* (page 234 / 238) */
-		hsdmmc->capacity = (unpackReg(hsdmmc->CSD, C_SIZE_v3) + 1)
-				* (512 * 1024);
-		hsdmmc->blockcount = hsdmmc->capacity / hsdmmc->blocklen_RD;
+		/* (page 234 / 238) C_SIZE is in 512KiB units (1024 blocks) */
+		hsdmmc->blockcount = ((SDMMC_SectorCount) unpackReg(hsdmmc->CSD,
+				hsdmmc->CSD_ver == 3 ? C_SIZE_v3 : C_SIZE_v2) + 1) * 1024;
 	}
 
 	hsdmmc->state = SMST_READY;
@@ -484,18 +743,115 @@ SDMMC_State SDMMC_get_state(SDMMC_SPI_HandleTypeDef *hsdmmc) {
 	return hsdmmc->state;
 }
 
+/* Multi-sector requests are served by a single CMD18 / CMD25 transfer *
+ * straight into / from the caller's buffer, without splitting them.   */
 SDMMC_State SDMMC_read(SDMMC_SPI_HandleTypeDef *hsdmmc, uint8_t *buff,
 		uint32_t sector, uint32_t count) {
-	// TODO
+	return SDMMC_read64(hsdmmc, buff, sector, count);
+}
 
-	return hsdmmc->state;
+SDMMC_State SDMMC_read64(SDMMC_SPI_HandleTypeDef *hsdmmc, uint8_t *buff,
+		uint64_t sector, uint32_t count) {
+	SDMMC_Status sta;
+
+	if (hsdmmc->state != SMST_READY)
+		return hsdmmc->state;
+	/* Out of range sectors would wrap the byte address of SDSC cards */
+	if (count == 0 || count > hsdmmc->blockcount
+			|| sector > hsdmmc->blockcount - count)
+		return SMST_ERROR;
+
+	SDMMC_select(hsdmmc);
+
+	if (count == 1) {
+		sta = SDMMC_command_sector(hsdmmc, CMD17, sector);
+		if (sta == SM_OK)
+			sta = SDMMC_read_datablock(hsdmmc, buff, BLOCKLEN);
+	} else {
+		sta = SDMMC_command_sector(hsdmmc, CMD18, sector);
+		if (sta == SM_OK) {
+			do {
+				sta = SDMMC_read_datablock(hsdmmc, buff, BLOCKLEN);
+				buff += BLOCKLEN;
+			} while (sta == SM_OK && --count);
+			/* The transfer has to be stopped even if a block failed, *
+			 * a card stuck in it needs a re-initialization           */
+			if (SDMMC_command(hsdmmc, CMD12, 0) != SM_OK
+					|| SDMMC_busy_wait(hsdmmc) != SM_OK) {
+				hsdmmc->state = SMST_ERROR;
+				sta = SM_ERROR;
+			}
+		}
+	}
+
+	SDMMC_deselect(hsdmmc);
+	return sta == SM_OK ? hsdmmc->state : SMST_ERROR;
 }
 
 SDMMC_State SDMMC_write(SDMMC_SPI_HandleTypeDef *hsdmmc, const uint8_t *buff,
 		uint32_t sector, uint32_t count) {
-	// TODO
+	return SDMMC_write64(hsdmmc, buff, sector, count);
+}
 
-	return hsdmmc->state;
+SDMMC_State SDMMC_write64(SDMMC_SPI_HandleTypeDef *hsdmmc,
+		const uint8_t *buff, uint64_t sector, uint32_t count) {
+	SDMMC_Status sta;
+
+	if (hsdmmc->state != SMST_READY)
+		return hsdmmc->state;
+	/* Out of range sectors would wrap the byte address of SDSC cards */
+	if (count == 0 || count > hsdmmc->blockcount
+			|| sector > hsdmmc->blockcount - count)
+		return SMST_ERROR;
+
+	if (count > 1) {
+		/* A single CMD25 transfer preallocated for exactly count blocks */
+		if (SDMMC_multi_write_begin(hsdmmc, sector, count) != SM_OK)
+			return SMST_ERROR;
+		do {
+			sta = SDMMC_write_datablock(hsdmmc, buff, BLOCKLEN,
+					TOKEN_MULTI_WRITE);
+			buff += BLOCKLEN;
+		} while (sta == SM_OK && --count);
+		/* The transfer has to be stopped even if a block failed, *
+		 * a card stuck in it needs a re-initialization           */
+		if (SDMMC_multi_write_end(hsdmmc) != SM_OK) {
+			hsdmmc->state = SMST_ERROR;
+			sta = SM_ERROR;
+		}
+		return sta == SM_OK ? hsdmmc->state : SMST_ERROR;
+	}
+
+	SDMMC_select(hsdmmc);
+	sta = SDMMC_command_sector(hsdmmc, CMD24, sector);
+	if (sta == SM_OK)
+		sta = SDMMC_write_datablock(hsdmmc, buff, BLOCKLEN,
+				TOKEN_SINGLE_BLOCK);
+	if (sta == SM_OK) {
+		sta = SDMMC_busy_wait(hsdmmc);
+		if (sta != SM_OK)
+			hsdmmc->state = SMST_ERROR; //Card still programming
+	}
+	SDMMC_deselect(hsdmmc);
+
+	return sta == SM_OK ? hsdmmc->state : SMST_ERROR;
+}
+
+/* MMC uses another erase command set and CSD v1 cards without        *
+ * ERASE_BLK_EN widen the erase to whole sectors, wiping live data.    *
+ * Both skip it as TRIM is only a hint.                                */
+SDMMC_Result SDMMC_trim(SDMMC_SPI_HandleTypeDef *hsdmmc, uint64_t start,
+		uint64_t end) {
+	if (hsdmmc->state != SMST_READY)
+		return SDMMC_RES_NOTRDY;
+	if (start > end || end >= hsdmmc->blockcount)
+		return SDMMC_RES_PARERR;
+	if (CARD_IS_MMC(hsdmmc)
+			|| (hsdmmc->CSD_ver == 1 && !unpackReg(hsdmmc->CSD, ERASE_BLK_EN)))
+		return SDMMC_RES_OK;
+
+	return SDMMC_erase(hsdmmc, start, end) == SM_OK ?
+			SDMMC_RES_OK : SDMMC_RES_ERROR;
 }
 
 SDMMC_Result SDMMC_ioctl(SDMMC_SPI_HandleTypeDef *hsdmmc, uint8_t ctrl,
@@ -526,27 +882,113 @@ SDMMC_Result SDMMC_ioctl(SDMMC_SPI_HandleTypeDef *hsdmmc, uint8_t ctrl,
 		}
 		break;
 	case GET_SECTOR_COUNT:
+#if SDMMC_CONF_SDUC
+		/* Saturated, use the blockcount of the handle on larger cards */
+		*(uint32_t*) buff = hsdmmc->blockcount > UINT32_MAX ?
+				UINT32_MAX : (uint32_t) hsdmmc->blockcount;
+#else
 		*(uint32_t*) buff = hsdmmc->blockcount;
+#endif
 		break;
 	case GET_SECTOR_SIZE:
-		*(uint16_t*) buff = hsdmmc->blocklen_RD;
+		*(uint16_t*) buff = BLOCKLEN;
 		res = SDMMC_RES_OK;
 		break;
+	case GET_BLOCK_SIZE:
+		/* Erase block size in sectors */
+		*(DWORD*) buff = hsdmmc->sectorlen;
+		break;
 	case CTRL_SYNC:
 		res = SDMMC_ReadyWait(hsdmmc);
+		if (res == SDMMC_RES_OK) {
+			/* Wait for the card to finish any pending programming */
+			SDMMC_select(hsdmmc);
+			if (SDMMC_busy_wait(hsdmmc) != SM_OK)
+				res = SDMMC_RES_ERROR;
+			SDMMC_deselect(hsdmmc);
+		}
+		break;
+	case CTRL_TRIM:
+		/* buff: {start sector, end sector} */
+		res = SDMMC_trim(hsdmmc, ((DWORD*) buff)[0], ((DWORD*) buff)[1]);
 		break;
 	case MMC_GET_CSD:
 		memcpy(buff, hsdmmc->CSD, 16);
 		break;
+#if SDMMC_CONF_KEEP_REGS
 	case MMC_GET_CID:
 		memcpy(buff, hsdmmc->CID, 16);
 		break;
 	case MMC_GET_OCR:
 		memcpy(buff, &hsdmmc->OCR, 4);
 		break;
+#endif
 	default:
 		res = SDMMC_RES_PARERR;
 	}
 
 	return res;
 }
+
+#if SDMMC_CONF_STREAM
+/***************************************
+ * Continuous write stream
+ **************************************/
+
+/* Opens a CMD25 multi-block write at sector and keeps it open until   *
+ * SDMMC_stream_close. The count is only a pre-erase hint (ACMD23) for *
+ * SD cards, appending past it is allowed. Returns SMST_STREAM if the  *
+ * stream has been opened.                                             */
+SDMMC_State SDMMC_stream_open(SDMMC_SPI_HandleTypeDef *hsdmmc, uint64_t sector,
+		uint32_t count) {
+	if (hsdmmc->state == SMST_STREAM)
+		return SMST_BUSY;
+	if (hsdmmc->state != SMST_READY)
+		return hsdmmc->state;
+
+	if (SDMMC_multi_write_begin(hsdmmc, sector, count) != SM_OK)
+		return SMST_ERROR;
+
+	hsdmmc->stream_written = 0;
+	hsdmmc->state = SMST_STREAM;
+	return hsdmmc->state;
+}
+
+/* Sends count blocks into the open stream. On a failed block the stream *
+ * is closed and SMST_ERROR is returned, stream_written tells how many   *
+ * blocks made it to the card.                                           */
+SDMMC_State SDMMC_stream_append(SDMMC_SPI_HandleTypeDef *hsdmmc,
+		const uint8_t *buff, uint32_t count) {
+	SDMMC_Status sta;
+
+	if (hsdmmc->state != SMST_STREAM)
+		return hsdmmc->state;
+
+	while (count--) {
+		sta = SDMMC_write_datablock(hsdmmc, buff, BLOCKLEN,
+				TOKEN_MULTI_WRITE);
+		if (sta != SM_OK) {
+			SDMMC_stream_close(hsdmmc);
+			return SMST_ERROR;
+		}
+		buff += BLOCKLEN;
+		hsdmmc->stream_written++;
+	}
+
+	return hsdmmc->state;
+}
+
+/* Terminates the stream with the Stop Tran token and waits until the card *
+ * finished programming. Call it on flush, file switch or power-fail.      *
+ * On failure the handle is left in SMST_ERROR.                            */
+SDMMC_State SDMMC_stream_close(SDMMC_SPI_HandleTypeDef *hsdmmc) {
+	if (hsdmmc->state != SMST_STREAM)
+		return hsdmmc->state;
+
+	/* A card still programming or waiting for data would misread the next *
+	 * command, so a failed close needs a re-initialization.               */
+	hsdmmc->state = SDMMC_multi_write_end(hsdmmc) == SM_OK ?
+			SMST_READY : SMST_ERROR;
+	return hsdmmc->state;
+}
+#endif /* SDMMC_CONF_STREAM */
@@ -10,6 +10,7 @@
 #define SDMMC_SPI_H_
 
 #include "main.h"   /* For including the applicable HAL header */
+#include "sdmmc_spi_conf.h"
 
 /* R1 response flags */
 #define R1_IDLE         0x01U   /* In Idle State */
@@ -26,7 +27,7 @@
 #define GET_SECTOR_COUNT	1	/* Get media size (needed at _USE_MKFS == 1) */
 #define GET_SECTOR_SIZE		2	/* Get sector size (needed at _MAX_SS != _MIN_SS) */
 #define GET_BLOCK_SIZE		3	/* Get erase block size (needed at _USE_MKFS == 1) */
-//#define CTRL_TRIM		4	/* Inform device that the data on the block of sectors is no longer used (needed at _USE_TRIM == 1) */
+#define CTRL_TRIM		4	/* Inform device that the data on the block of sectors is no longer used (needed at _USE_TRIM == 1) */
 
 /* Generic command (Not used by FatFs) */
 //#define CTRL_POWER			5	/* Get/Set power status */
@@ -59,7 +60,8 @@ typedef enum {
 	SMST_RESET = 0U,
 	SMST_READY = 1U,
 	SMST_BUSY  = 2U,
-	SMST_ERROR = 3U
+	SMST_ERROR = 3U,
+	SMST_STREAM = 4U /* A multi-block write stream is open, CS is held low */
 } SDMMC_State;
 
 typedef enum {
@@ -78,6 +80,13 @@ typedef enum {
 	SDMMC_RES_PARERR /* 4: Invalid Parameter */
 } SDMMC_Result;
 
+/* Sector count of the card, 64 bit only when SDUC (over 2TB) is supported */
+#if SDMMC_CONF_SDUC
+typedef uint64_t SDMMC_SectorCount;
+#else
+typedef uint32_t SDMMC_SectorCount;
+#endif
+
 typedef union __attribute__((__packed__)) {
 	struct {
 		uint8_t IDLE :1; /* In Idle State */
@@ -155,26 +164,32 @@ typedef struct __SDMMC_SPI_HandleTypeDef {
 	uint8_t CS_Lock; /* Providing thread safety (not tested) */
 	uint32_t timeout; /* Operation time limit in systicks */
 	uint8_t max_retry; /* Command maximum retry count before fail */
+#if SDMMC_CONF_DIAG
 	uint8_t errorToken; /* Last error token returned by a data transfer */
 	uint8_t responseToken; /* Data Response of last data transfer */
+#endif
 	SDMMC_CardType type; /* Type of memory card for handling protocol differences */
+#if SDMMC_CONF_KEEP_REGS
 	uint32_t OP_COND; /* Operational Conditions */
 	uint32_t IF_COND; /* Interface Condition */
 	SDMMC_OCR_Reg OCR; /* Operation Conditions Register (page 222) */
 	uint8_t CID[16]; /* Card Identification Register (page 224) */
+#endif
 //	uint16_t RCA[; /* Relative Card Address Register */
 //	uint16_t DSR[; /* Driver Stage Register */
 	uint8_t CSD[16]; /* Card Specific Data (page 225) */
 	uint8_t CSD_ver; /* CSD register version */
 //	uint32_t SCR[2]; /* SD Configuration Register */
-	uint16_t blocklen_RD; /* Size of transfer data blocks and also the default logical sector size */
-	uint16_t blocklen_WR; /* Same as blocklen_RD but for write transfers */
-	uint32_t blockcount; /* SDMMC memory capacity in blocks */
-	uint64_t capacity; /* SDMMC memory capacity in bytes */
-	uint8_t sectorlen; /* Size of an erasable sector in blocks */
+	SDMMC_SectorCount blockcount; /* SDMMC memory capacity in 512 byte blocks */
+	uint16_t sectorlen; /* Size of an erasable sector in 512 byte blocks */
 	SDMMC_State state; /* An internal state of the driver, hopefully prevents corruption */
+#if SDMMC_CONF_DIAG
 	SDMMC_ResponseType response_type; /* Type of the last command response */
+#endif
 	SDMMC_Response response; /* Response from the last applied command */
+#if SDMMC_CONF_STREAM
+	uint32_t stream_written; /* Blocks appended to the open stream so far */
+#endif
 //	uint32_t sectorAddress;
 //	uint32_t sectorCount;
 //	uint8_t *RXbuff;
@@ -188,8 +203,24 @@ SDMMC_State SDMMC_read(SDMMC_SPI_HandleTypeDef *hsdmmc, uint8_t *buff,
 		uint32_t sector, uint32_t count);
 SDMMC_State SDMMC_write(SDMMC_SPI_HandleTypeDef *hsdmmc, const uint8_t *buff,
 		uint32_t sector, uint32_t count);
+/* 64 bit sector variants, required beyond 2TB (SDUC) */
+SDMMC_State SDMMC_read64(SDMMC_SPI_HandleTypeDef *hsdmmc, uint8_t *buff,
+		uint64_t sector, uint32_t count);
+SDMMC_State SDMMC_write64(SDMMC_SPI_HandleTypeDef *hsdmmc,
+		const uint8_t *buff, uint64_t sector, uint32_t count);
 SDMMC_Result SDMMC_ioctl(SDMMC_SPI_HandleTypeDef *hsdmmc, uint8_t cmd,
 		void *buff);
+SDMMC_Result SDMMC_trim(SDMMC_SPI_HandleTypeDef *hsdmmc, uint64_t start,
+		uint64_t end);
+
+#if SDMMC_CONF_STREAM
+/* Continuous write stream (CMD25 kept open across calls) */
+SDMMC_State SDMMC_stream_open(SDMMC_SPI_HandleTypeDef *hsdmmc, uint64_t sector,
+		uint32_t count);
+SDMMC_State SDMMC_stream_append(SDMMC_SPI_HandleTypeDef *hsdmmc,
+		const uint8_t *buff, uint32_t count);
+SDMMC_State SDMMC_stream_close(SDMMC_SPI_HandleTypeDef *hsdmmc);
+#endif
 /* TODO docstring style function desctiptions would be nice */
 
 #endif /* SDMMC_SPI_H_ */
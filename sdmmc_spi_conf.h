@@ -0,0 +1,52 @@
+/* TODO write some fancy header with copyright information */
+/**/
+/**/
+/**/
+/**/
+/**/
+/* Build time profile of the SDMMC SPI driver.                           *
+ * Each option may be overridden from the compiler command line, the     *
+ * defaults below build the full featured driver with runtime detection. */
+
+#ifndef SDMMC_SPI_CONF_H_
+#define SDMMC_SPI_CONF_H_
+
+/* 1: only block addressed cards (SDHC / SDXC / SDUC) are supported. *
+ *    SD1, byte addressed SD2 and MMC handling is left out.          */
+#ifndef SDMMC_CONF_SDHC_ONLY
+#define SDMMC_CONF_SDHC_ONLY	0
+#endif
+
+/* 1: SDUC detection and CMD22 extended addressing */
+#ifndef SDMMC_CONF_SDUC
+#define SDMMC_CONF_SDUC		1
+#endif
+
+/* 1: continuous write stream API (SDMMC_stream_open / _append / _close) */
+#ifndef SDMMC_CONF_STREAM
+#define SDMMC_CONF_STREAM	1
+#endif
+
+/* 1: data blocks are sent with their CRC16 and received ones are verified */
+#ifndef SDMMC_CONF_DATA_CRC
+#define SDMMC_CONF_DATA_CRC	0
+#endif
+
+/* 1: the handle keeps the last data tokens and response type for debugging */
+#ifndef SDMMC_CONF_DIAG
+#define SDMMC_CONF_DIAG		1
+#endif
+
+/* 1: the handle keeps copies of the CID and OCR registers *
+ *    (MMC_GET_CID and MMC_GET_OCR ioctl)                  */
+#ifndef SDMMC_CONF_KEEP_REGS
+#define SDMMC_CONF_KEEP_REGS	1
+#endif
+
+/* Busy time limit of an erase (CTRL_TRIM) in systicks. Erasing a large  *
+ * range takes much longer than the per-operation timeout of the handle. */
+#ifndef SDMMC_CONF_ERASE_TIMEOUT
+#define SDMMC_CONF_ERASE_TIMEOUT	30000U
+#endif
+
+#endif /* SDMMC_SPI_CONF_H_ */